@@ -25,11 +25,32 @@ void _lock_wire(void);
 void _unlock_wire(void);
 void _lock_note(void);
 void _unlock_note(void);
+void _lock_console(void);
+void _unlock_console(void);
 
 // Basic allocation functions
 void *_malloc(size_t size);
 void _free(void *);
 
+// Allocation accounting.  Every block handed out by _malloc carries a small
+// header recording its size and the subsystem that allocated it, so that
+// outstanding bytes can be attributed when the block is freed.
+#define MEM_SUBSYS_APP      0       // _malloc() callers in the app
+#define MEM_SUBSYS_NOTE     1       // note-c, including all J objects
+#define MEM_SUBSYS_CONSOLE  2       // console fan-out buffers
+#define MEM_SUBSYS_COUNT    3
+typedef struct {
+    uint32_t allocs;                // successful allocations
+    uint32_t frees;                 // blocks returned
+    uint32_t failures;              // allocations that returned NULL
+    uint32_t bytes;                 // bytes currently outstanding
+    uint32_t peakBytes;             // high-water mark of bytes outstanding
+} memSubsysStats;
+void *_malloc_subsys(size_t size, uint32_t subsys);
+void *_malloc_note(size_t size);
+bool _malloc_stats(uint32_t subsys, memSubsysStats *stats);
+const char *_malloc_subsys_name(uint32_t subsys);
+
 // Time functions
 void _delay(uint32_t ms);
 uint32_t _millis(void);
@@ -41,6 +62,7 @@ uint32_t _millis(void);
 
 SemaphoreHandle_t _wireMutex;
 SemaphoreHandle_t _noteMutex;
+SemaphoreHandle_t _consoleMutex;
 bool _setup()
 {
     _wireMutex = xSemaphoreCreateMutex();
@@ -51,6 +73,10 @@ bool _setup()
     if (_noteMutex == NULL) {
         return false;
     }
+    _consoleMutex = xSemaphoreCreateMutex();
+    if (_consoleMutex == NULL) {
+        return false;
+    }
     return true;
 }
 void _setup_completed()
@@ -75,14 +101,43 @@ void _unlock_note()
 {
     xSemaphoreGive(_noteMutex);
 }
-void *_malloc(size_t size)
+void _lock_console()
+{
+    xSemaphoreTake(_consoleMutex, portMAX_DELAY);
+}
+void _unlock_console()
+{
+    xSemaphoreGive(_consoleMutex);
+}
+static void *_malloc_raw(size_t size)
 {
     return pvPortMalloc(size);
 }
-void _free(void *p)
+static void _free_raw(void *p)
 {
     vPortFree(p);
 }
+#if defined(ARDUINO_ARCH_ESP32)
+// Suspending the scheduler only stops the calling core, so use a spinlock
+portMUX_TYPE _mallocStatsMux = portMUX_INITIALIZER_UNLOCKED;
+static void _lock_malloc_stats()
+{
+    portENTER_CRITICAL(&_mallocStatsMux);
+}
+static void _unlock_malloc_stats()
+{
+    portEXIT_CRITICAL(&_mallocStatsMux);
+}
+#else
+static void _lock_malloc_stats()
+{
+    vTaskSuspendAll();
+}
+static void _unlock_malloc_stats()
+{
+    xTaskResumeAll();
+}
+#endif
 void _delay(uint32_t ms)
 {
     vTaskDelay((uint32_t)((((uint64_t) ms * configTICK_RATE_HZ)) / 1000LL));
@@ -98,6 +153,8 @@ void _lock_wire() {}
 void _unlock_wire() {}
 void _lock_note() {}
 void _unlock_note() {}
+void _lock_console() {}
+void _unlock_console() {}
 bool _setup()
 {
     return true;
@@ -105,14 +162,16 @@ bool _setup()
 void _setup_completed()
 {
 }
-void *_malloc(size_t size)
+static void *_malloc_raw(size_t size)
 {
     return malloc(size);
 }
-void _free(void *p)
+static void _free_raw(void *p)
 {
     free(p);
 }
+static void _lock_malloc_stats() {}
+static void _unlock_malloc_stats() {}
 void _delay(uint32_t ms)
 {
     delay(ms);
@@ -128,14 +187,18 @@ __attribute__((weak)) void _lock_wire() {}
 __attribute__((weak)) void _unlock_wire() {}
 __attribute__((weak)) void _lock_note() {}
 __attribute__((weak)) void _unlock_note() {}
-void *_malloc(size_t size)
+__attribute__((weak)) void _lock_console() {}
+__attribute__((weak)) void _unlock_console() {}
+static void *_malloc_raw(size_t size)
 {
     return malloc(size);
 }
-void _free(void *p)
+static void _free_raw(void *p)
 {
     free(p);
 }
+static void _lock_malloc_stats() {}
+static void _unlock_malloc_stats() {}
 __attribute__((weak)) void _delay(uint32_t ms) {}
 __attribute__((weak)) uint32_t _millis(void)
 {
@@ -144,4 +207,85 @@ __attribute__((weak)) uint32_t _millis(void)
 
 #endif	// Which RTOS
 
+// Header prepended to each block, padded so that the caller's block retains
+// the allocator's natural alignment.
+typedef union {
+    struct {
+        uint32_t size;
+        uint32_t subsys;
+    } h;
+    uint64_t align;
+} _malloc_header;
+
+memSubsysStats _mallocStats[MEM_SUBSYS_COUNT];
+
+void *_malloc_subsys(size_t size, uint32_t subsys)
+{
+    if (subsys >= MEM_SUBSYS_COUNT) {
+        subsys = MEM_SUBSYS_APP;
+    }
+    _malloc_header *hdr = (_malloc_header *) _malloc_raw(sizeof(_malloc_header) + size);
+    _lock_malloc_stats();
+    memSubsysStats *stats = &_mallocStats[subsys];
+    if (hdr == NULL) {
+        stats->failures++;
+    } else {
+        stats->allocs++;
+        stats->bytes += size;
+        if (stats->bytes > stats->peakBytes) {
+            stats->peakBytes = stats->bytes;
+        }
+    }
+    _unlock_malloc_stats();
+    if (hdr == NULL) {
+        return NULL;
+    }
+    hdr->h.size = size;
+    hdr->h.subsys = subsys;
+    return &hdr[1];
+}
+void *_malloc(size_t size)
+{
+    return _malloc_subsys(size, MEM_SUBSYS_APP);
+}
+void *_malloc_note(size_t size)
+{
+    return _malloc_subsys(size, MEM_SUBSYS_NOTE);
+}
+void _free(void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    _malloc_header *hdr = &((_malloc_header *) p)[-1];
+    _lock_malloc_stats();
+    memSubsysStats *stats = &_mallocStats[hdr->h.subsys];
+    stats->frees++;
+    stats->bytes -= hdr->h.size;
+    _unlock_malloc_stats();
+    _free_raw(hdr);
+}
+bool _malloc_stats(uint32_t subsys, memSubsysStats *stats)
+{
+    if (subsys >= MEM_SUBSYS_COUNT) {
+        return false;
+    }
+    _lock_malloc_stats();
+    *stats = _mallocStats[subsys];
+    _unlock_malloc_stats();
+    return true;
+}
+const char *_malloc_subsys_name(uint32_t subsys)
+{
+    switch (subsys) {
+    case MEM_SUBSYS_APP:
+        return "app";
+    case MEM_SUBSYS_NOTE:
+        return "note";
+    case MEM_SUBSYS_CONSOLE:
+        return "console";
+    }
+    return "?";
+}
+
 #endif	// APP_MAIN
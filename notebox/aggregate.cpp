@@ -0,0 +1,182 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "main.h"
+#include <math.h>
+
+// Streaming statistics for one numeric field over the current window, along
+// with the last value sent upstream, which survives from window to window
+typedef struct {
+    char name[AGG_FIELD_NAME_MAX];
+    uint32_t count;
+    double min;
+    double max;
+    double sum;
+    double last;
+    double reported;
+    bool hasReported;
+} aggField;
+aggField aggFields[AGG_MAX_FIELDS];
+uint32_t aggFieldCount = 0;
+
+// Configuration, from the environment
+uint32_t aggWindowSecs = 0;
+double aggChange = 0;
+
+// Window state
+uint32_t aggWindowStartMs = 0;
+uint32_t aggLinesAggregated = 0;
+uint32_t aggLinesPassed = 0;
+
+// Forwards
+aggField *aggFind(const char *name);
+
+// Update aggregation config from env vars.  Aggregation is off unless
+// aggregate_seconds is set, and aggregate_change (absolute) optionally lets
+// any line through immediately when one of its fields moves that far.
+void aggregateUpdateConfig(J *env)
+{
+    aggWindowSecs = (uint32_t) atoi(JGetString(env, AGG_ENV_SECONDS));
+    aggChange = atof(JGetString(env, AGG_ENV_CHANGE));
+}
+
+// True if lines may be absorbed into a window
+bool aggregateEnabled(void)
+{
+    return aggWindowSecs != 0;
+}
+
+// Find a field in the table, or NULL
+aggField *aggFind(const char *name)
+{
+    for (uint32_t i=0; i<aggFieldCount; i++) {
+        if (streql(aggFields[i].name, name)) {
+            return &aggFields[i];
+        }
+    }
+    return NULL;
+}
+
+// Fold a message into the current window if it's purely numeric telemetry,
+// returning true if it was absorbed and false if it should be sent as usual.
+bool aggregateMessage(J *body)
+{
+    if (aggWindowSecs == 0 || body == NULL || body->child == NULL) {
+        return false;
+    }
+
+    // Make sure that every field is numeric and that there's room for it
+    uint32_t newFields = 0;
+    for (J *item = body->child; item != NULL; item = item->next) {
+        if (!JIsNumber(item) || strNULL(item->string) || strlen(item->string) >= AGG_FIELD_NAME_MAX) {
+            return false;
+        }
+        if (aggFind(item->string) == NULL) {
+            newFields++;
+        }
+    }
+    if (aggFieldCount + newFields > AGG_MAX_FIELDS) {
+        return false;
+    }
+
+    // Accumulate, noting whether any field has moved far enough from what was
+    // last sent upstream to warrant passthrough
+    if (aggLinesAggregated == 0 && aggLinesPassed == 0) {
+        aggWindowStartMs = _millis();
+    }
+    bool passthrough = false;
+    for (J *item = body->child; item != NULL; item = item->next) {
+        double value = item->valuenumber;
+        aggField *field = aggFind(item->string);
+        if (field == NULL) {
+            field = &aggFields[aggFieldCount++];
+            strlcpy(field->name, item->string, sizeof(field->name));
+            field->count = 0;
+            field->sum = 0;
+            field->hasReported = false;
+        }
+        if (aggChange > 0 && field->hasReported && fabs(value - field->reported) >= aggChange) {
+            passthrough = true;
+        }
+        if (field->count == 0 || value < field->min) {
+            field->min = value;
+        }
+        if (field->count == 0 || value > field->max) {
+            field->max = value;
+        }
+        field->sum += value;
+        field->last = value;
+        field->count++;
+    }
+    if (passthrough) {
+        for (J *item = body->child; item != NULL; item = item->next) {
+            aggField *field = aggFind(item->string);
+            field->reported = item->valuenumber;
+            field->hasReported = true;
+        }
+        aggLinesPassed++;
+        return false;
+    }
+    aggLinesAggregated++;
+    return true;
+
+}
+
+// Emit a summary record when the window closes (or aggregation is turned off)
+bool aggregatePoll(void)
+{
+    if (aggLinesAggregated == 0 && aggLinesPassed == 0) {
+        return false;
+    }
+    uint32_t elapsedMs = _millis() - aggWindowStartMs;
+    if (aggWindowSecs != 0 && elapsedMs < (aggWindowSecs * 1000UL)) {
+        return false;
+    }
+
+    // Build the summary
+    J *body = JCreateObject();
+    if (body != NULL) {
+        JAddNumberToObject(body, "id", uniqueId());
+        JAddStringToObject(body, "class", "summary");
+        JAddIntToObject(body, "seconds", elapsedMs / 1000);
+        JAddIntToObject(body, "aggregated", aggLinesAggregated);
+        JAddIntToObject(body, "passed", aggLinesPassed);
+        J *fields = JAddObjectToObject(body, "fields");
+        for (uint32_t i=0; fields != NULL && i<aggFieldCount; i++) {
+            if (aggFields[i].count == 0) {
+                continue;
+            }
+            J *field = JAddObjectToObject(fields, aggFields[i].name);
+            if (field != NULL) {
+                JAddNumberToObject(field, "min", aggFields[i].min);
+                JAddNumberToObject(field, "max", aggFields[i].max);
+                JAddNumberToObject(field, "mean", aggFields[i].sum / aggFields[i].count);
+                JAddIntToObject(field, "count", aggFields[i].count);
+                JAddNumberToObject(field, "last", aggFields[i].last);
+            }
+        }
+        postToNotecard(body);
+    }
+    debugf("aggregate: %d lines summarized, %d passed through\n", aggLinesAggregated, aggLinesPassed);
+
+    // Start a new window, remembering what was reported for each field that was
+    // present and dropping those that weren't so the table doesn't fill with
+    // names the host no longer sends
+    uint32_t kept = 0;
+    for (uint32_t i=0; i<aggFieldCount; i++) {
+        if (aggFields[i].count == 0) {
+            continue;
+        }
+        aggFields[i].reported = aggFields[i].last;
+        aggFields[i].hasReported = true;
+        aggFields[i].count = 0;
+        aggFields[i].sum = 0;
+        aggFields[kept++] = aggFields[i];
+    }
+    aggFieldCount = kept;
+    aggLinesAggregated = 0;
+    aggLinesPassed = 0;
+    return true;
+
+}
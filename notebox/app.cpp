@@ -49,6 +49,9 @@ void appTask(void *param)
 {
     (void) param;
 
+	// Monitor our stack usage
+	memRegisterTask(TASKNAME_APP, TASKSTACK_APP);
+
 	// Version
 	appSignal(1);
     debugf(PRODUCT_VERSION "\n");
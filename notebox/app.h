@@ -117,6 +117,18 @@ extern bool appHasLoRa;
 #define TASKSTACK_MAIN				2000
 #define TASKPRI_MAIN				( configMAX_PRIORITIES - 4 )        // normal, in the middle
 
+// Memory telemetry.  Stack figures are reported and compared in bytes, even
+// though TASKSTACK_* is in words on STM32 and bytes on ESP32.
+#define MEM_CHECK_SECS              60
+#define MEM_REPORT_SECS             (6*60*60)
+#define MEM_WARN_STACK_UNUSED       600         // bytes
+#define MEM_WARN_HEAP_FREE          4096
+#define MEM_NOTEFILE                "mem.qo"
+
+// mem.cpp
+void memRegisterTask(const char *name, uint32_t stackSize);
+void memPoll(void);
+
 // main.cpp
 void mainTask(void *param);
 bool mainPoll(void);
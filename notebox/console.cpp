@@ -0,0 +1,339 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "main.h"
+
+// Hardware console ports
+HardwareSerial consoleUART(WIRING_RX_FM_CONSOLE_TX, WIRING_TX_TO_CONSOLE_RX);
+#ifdef WIRING_RX_FM_CONSOLE2_TX
+HardwareSerial consoleUART2(WIRING_RX_FM_CONSOLE2_TX, WIRING_TX_TO_CONSOLE2_RX);
+#endif
+
+// A console port, with its own queue of references to shared buffers so that a
+// slow or disconnected host never stalls delivery to the others.
+typedef struct {
+    const char *name;
+    Stream *stream;
+    bool reportsCapacity;
+    uint32_t defaultSubscriptions;
+    uint32_t subscriptions;
+    consoleBuffer *queue[CONSOLE_QUEUE_DEPTH];
+    uint32_t queueHead;
+    uint32_t queueCount;
+    uint32_t offset;
+    uint32_t dropped;
+    bool stalled;
+} consolePort;
+consolePort consolePorts[CONSOLE_MAX_PORTS];
+volatile uint32_t consolePortCount = 0;
+
+// Outbound message IDs, and the port that sent them, so replies can be routed back
+typedef struct {
+    uint32_t messageID;
+    int port;
+} consoleSent;
+consoleSent consoleSentIDs[CONSOLE_SENT_IDS];
+uint32_t consoleSentNext = 0;
+
+// Forwards
+String trimEnd(String str);
+
+// Wait for a port to come up after having begun it
+template <typename T>
+bool consoleWaitFor(T &port)
+{
+    uint32_t expires = millis() + 2500;
+    while (!port && millis() < expires);
+    return !!port;
+}
+
+// Initialize the hardware console ports.  We'll treat all of them as equals.
+void consoleBegin(void)
+{
+
+    consoleUSB.begin(CONSOLE_USB_SPEED);
+    if (consoleWaitFor(consoleUSB)) {
+        consoleAddPort("usb", &consoleUSB, true, CONSOLE_SUB_DEFAULT);
+    }
+
+    consoleUART.begin(CONSOLE_UART_SPEED);
+    if (consoleWaitFor(consoleUART)) {
+        consoleAddPort("uart", &consoleUART, true, CONSOLE_SUB_DEFAULT);
+    }
+
+#ifdef WIRING_RX_FM_CONSOLE2_TX
+    consoleUART2.begin(CONSOLE2_UART_SPEED);
+    if (consoleWaitFor(consoleUART2)) {
+        consoleAddPort("uart2", &consoleUART2, true, CONSOLE_SUB_DEFAULT);
+    }
+#endif
+
+}
+
+// Add a port to the table, returning its index or -1 if the table is full.  Any
+// Stream may be added, such as a pty endpoint in a host build.  Only a stream
+// whose availableForWrite() reports its real capacity is drained without
+// blocking; for any other, whatever is queued is simply written.
+int consoleAddPort(const char *name, Stream *stream, bool reportsCapacity, uint32_t subscriptions)
+{
+    int port = -1;
+    _lock_console();
+    if (consolePortCount < CONSOLE_MAX_PORTS) {
+        port = consolePortCount;
+        consolePort *p = &consolePorts[port];
+        memset(p, 0, sizeof(consolePort));
+        p->name = name;
+        p->stream = stream;
+        p->reportsCapacity = reportsCapacity;
+        p->defaultSubscriptions = subscriptions;
+        p->subscriptions = subscriptions;
+        consolePortCount++;
+    }
+    _unlock_console();
+    if (port < 0) {
+        debugf("console: no room for port %s\n", name);
+    }
+    return port;
+}
+
+// Allocate a buffer holding a single reference.  The contents must not be
+// modified after it has been published.
+consoleBuffer *consoleBufferAlloc(uint32_t len)
+{
+    consoleBuffer *buf = (consoleBuffer *) _malloc_subsys(sizeof(consoleBuffer) + len, MEM_SUBSYS_CONSOLE);
+    if (buf == NULL) {
+        return NULL;
+    }
+    buf->refs = 1;
+    buf->len = len;
+    return buf;
+}
+
+// Drop a reference, freeing the buffer when it was the last
+void consoleBufferRelease(consoleBuffer *buf)
+{
+    _lock_console();
+    bool last = (--buf->refs == 0);
+    _unlock_console();
+    if (last) {
+        _free(buf);
+    }
+}
+
+// Queue a buffer to every port subscribed to its class of message, as well as
+// to the port awaiting it as a reply.  The caller's reference is consumed.
+void consolePublish(consoleBuffer *buf, uint32_t subscription, int replyPort)
+{
+    if (buf == NULL) {
+        return;
+    }
+    _lock_console();
+    for (int i=0; i<(int)consolePortCount; i++) {
+        consolePort *p = &consolePorts[i];
+        bool subscribed = (p->subscriptions & subscription) != 0;
+        if (i == replyPort && (p->subscriptions & CONSOLE_SUB_REPLIES) != 0) {
+            subscribed = true;
+        }
+        if (!subscribed) {
+            continue;
+        }
+        if (p->queueCount >= CONSOLE_QUEUE_DEPTH) {
+            p->dropped++;
+            continue;
+        }
+        buf->refs++;
+        p->queue[(p->queueHead + p->queueCount) % CONSOLE_QUEUE_DEPTH] = buf;
+        p->queueCount++;
+    }
+    _unlock_console();
+    consoleBufferRelease(buf);
+}
+
+// Publish a line of text, appending the newline
+void consolePublishText(const char *text, uint32_t subscription, int replyPort)
+{
+    consolePublishLine(text, strlen(text), subscription, replyPort);
+}
+
+// Publish a line of text of the given length, appending the newline
+void consolePublishLine(const char *text, uint32_t len, uint32_t subscription, int replyPort)
+{
+    consoleBuffer *buf = consoleBufferAlloc(len + 1);
+    if (buf == NULL) {
+        debugf("console: can't allocate %d byte buffer\n", len + 1);
+        return;
+    }
+    memcpy(buf->data, text, len);
+    buf->data[len] = '\n';
+    consolePublish(buf, subscription, replyPort);
+}
+
+// Remember which port sent a message, for routing replies
+void consoleMessageSent(uint32_t messageID, int port)
+{
+    if (messageID == 0 || port < 0) {
+        return;
+    }
+    _lock_console();
+    consoleSentIDs[consoleSentNext].messageID = messageID;
+    consoleSentIDs[consoleSentNext].port = port;
+    consoleSentNext = (consoleSentNext + 1) % CONSOLE_SENT_IDS;
+    _unlock_console();
+}
+
+// Find, and forget, the port that sent the message that this one replies to
+int consoleReplyPort(uint32_t messageID)
+{
+    int port = -1;
+    if (messageID == 0) {
+        return port;
+    }
+    _lock_console();
+    for (unsigned i=0; i<CONSOLE_SENT_IDS; i++) {
+        if (consoleSentIDs[i].messageID == messageID) {
+            consoleSentIDs[i].messageID = 0;
+            port = consoleSentIDs[i].port;
+            break;
+        }
+    }
+    _unlock_console();
+    return port;
+}
+
+// Update port subscriptions from env vars named by the port, such as
+// console_usb:"log,json,replies,env", reverting to the default when absent
+void consoleUpdateSubscriptions(J *env)
+{
+    _lock_console();
+    for (unsigned i=0; i<consolePortCount; i++) {
+        consolePort *p = &consolePorts[i];
+        char varName[32];
+        snprintf(varName, sizeof(varName), CONSOLE_ENV_PREFIX "%s", p->name);
+        const char *value = JGetString(env, varName);
+        if (value[0] == '\0') {
+            p->subscriptions = p->defaultSubscriptions;
+            continue;
+        }
+        uint32_t subscriptions = 0;
+        if (strstr(value, "log") != NULL) {
+            subscriptions |= CONSOLE_SUB_LOG;
+        }
+        if (strstr(value, "json") != NULL) {
+            subscriptions |= CONSOLE_SUB_JSON;
+        }
+        if (strstr(value, "replies") != NULL) {
+            subscriptions |= CONSOLE_SUB_REPLIES;
+        }
+        if (strstr(value, "env") != NULL) {
+            subscriptions |= CONSOLE_SUB_ENV;
+        }
+        p->subscriptions = subscriptions;
+    }
+    _unlock_console();
+}
+
+// Wait, up to a timeout, until every port has room in its queue, so that a
+// burst of messages isn't dropped by a port that is merely slow.  A port that
+// doesn't drain within the timeout is considered stalled, and isn't waited for
+// again until it makes progress.
+void consoleMakeRoom(uint32_t timeoutMs)
+{
+    uint32_t started = _millis();
+    while (true) {
+        bool full = false;
+        bool expired = (_millis() - started) >= timeoutMs;
+        _lock_console();
+        for (unsigned i=0; i<consolePortCount; i++) {
+            consolePort *p = &consolePorts[i];
+            if (p->queueCount >= CONSOLE_QUEUE_DEPTH && !p->stalled) {
+                if (expired) {
+                    p->stalled = true;
+                } else {
+                    full = true;
+                }
+            }
+        }
+        _unlock_console();
+        if (!full) {
+            return;
+        }
+        if (!consoleOutput()) {
+            _delay(1);
+        }
+    }
+}
+
+// Drain each port's queue as far as it will accept without blocking
+bool consoleOutput(void)
+{
+    bool didSomething = false;
+    _lock_console();
+    for (unsigned i=0; i<consolePortCount; i++) {
+        consolePort *p = &consolePorts[i];
+        if (p->dropped != 0) {
+            debugf("console: %s dropped %d messages\n", p->name, p->dropped);
+            p->dropped = 0;
+        }
+        while (p->queueCount > 0) {
+            consoleBuffer *buf = p->queue[p->queueHead];
+            uint32_t len = buf->len - p->offset;
+            if (p->reportsCapacity) {
+                int avail = p->stream->availableForWrite();
+                if (avail <= 0) {
+                    break;
+                }
+                if (len > (uint32_t) avail) {
+                    len = avail;
+                }
+            }
+            p->stream->write((const uint8_t *) &buf->data[p->offset], len);
+            p->offset += len;
+            p->stalled = false;
+            didSomething = true;
+            if (p->offset < buf->len) {
+                break;
+            }
+            p->offset = 0;
+            p->queueHead = (p->queueHead + 1) % CONSOLE_QUEUE_DEPTH;
+            p->queueCount--;
+            if (--buf->refs == 0) {
+                _free(buf);
+            }
+        }
+    }
+    _unlock_console();
+    return didSomething;
+}
+
+// Drain output, and forward any received lines to the notecard
+bool consolePoll(void)
+{
+    bool didSomething = consoleOutput();
+
+    // Input, which is done without the lock held because reading the line may block
+    _lock_console();
+    uint32_t portCount = consolePortCount;
+    _unlock_console();
+    for (unsigned i=0; i<portCount; i++) {
+        Stream *stream = consolePorts[i].stream;
+        if (stream->available()) {
+            String receivedString = stream->readStringUntil('\n');
+            sendMessageToNotecard(trimEnd(receivedString).c_str(), i);
+            didSomething = true;
+        }
+    }
+
+    // Done
+    return didSomething;
+
+}
+
+// Trim control chars from the end of the string
+String trimEnd(String str) {
+  int i = str.length() - 1;
+  while (i >= 0 && str[i] < ' ') {
+    i--;
+  }
+  return str.substring(0, i + 1);
+}
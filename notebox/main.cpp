@@ -6,21 +6,28 @@
 
 // AUX serial, for receiving notifications
 bool notecardAuxInitialized = false;
-bool consoleUARTInitialized = false;
-bool consoleUSBInitialized = false;
 HardwareSerial notecardAux(WIRING_RX_FM_NOTECARD_AUX_TX, WIRING_TX_TO_NOTECARD_AUX_RX);
-HardwareSerial consoleUART(WIRING_RX_FM_CONSOLE_TX, WIRING_TX_TO_CONSOLE_RX);
+
+// Inbound signal statistics, and when they were last reported
+uint32_t signalsReceived = 0;
+uint32_t signalBatches = 0;
+uint32_t signalBatchMessages = 0;
+uint32_t signalBatchMax = 0;
+uint32_t signalBatchesReported = 0;
+uint32_t signalLastReportedMs = 0;
+
+// Forwards
+bool claimReceivedMessageID(uint32_t messageID);
+uint32_t deliverMessage(J *message, const char *JSON);
+uint32_t deliverLog(const char *message);
+void recordBatch(uint32_t count);
+void reportSignalBatches(void);
 
 // Environment handling
 int64_t environmentModifiedTime = 0;
 bool refreshEnvironmentVars(void);
 void updateEnvironment(J *body);
 
-// Forwards
-void sendMessageToNotecard(const char *message);
-String trimEnd(String str);
-uint32_t uniqueId(void);
-
 // The most recently received message IDs
 uint32_t receivedMessageID[100] = {0};
 
@@ -29,23 +36,14 @@ void mainTask(void *param)
 {
     (void) param;
 
-	// Initialize console ports.  We'll treat the console and USB as equals
-    consoleUSB.begin(CONSOLE_USB_SPEED);
-	uint32_t expires = millis() + 2500;
-    while (!consoleUSB && millis() < expires);
-	if (consoleUSB) {
-		consoleUSBInitialized = true;
-	}
+	// Monitor our stack usage
+	memRegisterTask(TASKNAME_MAIN, TASKSTACK_MAIN);
 
-    consoleUART.begin(CONSOLE_UART_SPEED);
-	expires = millis() + 2500;
-    while (!consoleUART && millis() < expires);
-	if (consoleUART) {
-		consoleUARTInitialized = true;
-	}
+	// Initialize console ports
+	consoleBegin();
 
     notecardAux.begin(NOTECARD_AUX_SPEED);
-	expires = millis() + 2500;
+	uint32_t expires = millis() + 2500;
     while (!notecardAux && millis() < expires);
 	if (notecardAux) {
 		notecardAuxInitialized = true;
@@ -70,10 +68,12 @@ void mainTask(void *param)
     // Load the environment vars for the first time
     refreshEnvironmentVars();
 
-	// Do nothing.  In a more typical app, this is where the main
-	// processing would go.
+	// Periodically check memory health.  In a more typical app, this is
+	// where the main processing would go.
 	while (true) {
-		_delay(150000);
+		memPoll();
+		reportSignalBatches();
+		_delay(MEM_CHECK_SECS * 1000);
 	}
 
 }
@@ -107,17 +107,26 @@ bool refreshEnvironmentVars()
 
 }
 
-// Update the environment from the body
+// Update the environment from the body, and pass it along to any
+// console that is subscribed to environment changes as {"env":{...}}
 void updateEnvironment(J *body)
 {
-	(void) body;
-#ifndef NODEBUG
-	char *jsonTemp = JPrint(body);
+	consoleUpdateSubscriptions(body);
+	aggregateUpdateConfig(body);
+	char *jsonTemp = JPrintUnformatted(body);
 	if (jsonTemp != NULL) {
 		debugf("%s\n", jsonTemp);
+		uint32_t len = strlen(jsonTemp);
+		consoleBuffer *buf = consoleBufferAlloc(sizeof("{\"env\":}\n")-1 + len);
+		if (buf != NULL) {
+			char *p = buf->data;
+			memcpy(p, "{\"env\":", 7);
+			memcpy(p+7, jsonTemp, len);
+			memcpy(p+7+len, "}\n", 2);
+			consolePublish(buf, CONSOLE_SUB_ENV, -1);
+		}
 		_free(jsonTemp);
 	}
-#endif
 }
 
 // Main polling loop which performs tasks that map synchronous I/O to asynchronous
@@ -144,47 +153,31 @@ bool mainPoll(void)
 				const char *notificationType = JGetString(notification, "type");
 				for (;;) {
 
-					// If we've received something with a recognized command, process
-					// it, else send the entire JSON to it.
+					// If we've received a signal, deliver it, unpacking it first if
+					// it's a batch envelope, which is an object whose only field is
+					// a "batch" array, so that other messages may use that key
 					if (strEQL(notificationType, "")) {
-						const char *hostCmd = JGetString(notification, "class");
-						if (strEQL(hostCmd, "log")) {
-							const char *message = JGetString(notification, "message");
-							if (message[0] != '\0') {
-								consoleUART.write(message, strlen(message));
-								consoleUART.write("\n", 1);
-								consoleUSB.write(message, strlen(message));
-								consoleUSB.write("\n", 1);
-							}
-						} else {
-							char *jsonTemp = NULL;
-							uint32_t messageID = JGetInt(notification, "id");
-							if (messageID == 0) {
-								messageID = uniqueId();
-								JAddIntToObject(notification, "id", messageID);
-								jsonTemp = JPrint(notification);
-								if (jsonTemp != NULL) {
-									JSON = jsonTemp;
-								}
-							}
-							bool assigned = false;
-							for (unsigned i=0; i<(sizeof(receivedMessageID)/sizeof(receivedMessageID[0])); i++) {
-								if (receivedMessageID[i] == 0 && !assigned) {
-									receivedMessageID[i] = messageID;
-									assigned = true;
-								} else if (receivedMessageID[i] == messageID) {
-									receivedMessageID[i] = 0;
+						signalsReceived++;
+						J *batch = notification->child;
+						uint32_t delivered = 0;
+						if (batch != NULL && batch->next == NULL && streql(batch->string, "batch") && JIsArray(batch)) {
+							uint32_t skipped = 0;
+							for (J *item = batch->child; item != NULL; item = item->next) {
+								if (JIsObject(item)) {
+									delivered += deliverMessage(item, NULL);
+								} else {
+									skipped++;
 								}
 							}
-							consoleUART.write(JSON, strlen(JSON));
-							consoleUART.write("\n", 1);
-							consoleUSB.write(JSON, strlen(JSON));
-							consoleUSB.write("\n", 1);
-							if (jsonTemp != NULL) {
-								_free(jsonTemp);
+							if (skipped != 0) {
+								debugf("signal: skipped %d batch elements that aren't objects\n", skipped);
 							}
+						} else {
+							delivered = deliverMessage(notification, JSON);
+						}
+						if (delivered > 1) {
+							recordBatch(delivered);
 						}
-
 						break;
 					}
 
@@ -206,17 +199,13 @@ bool mainPoll(void)
 		}
 	}
 
-	// Do Console UART processing
-	if (consoleUARTInitialized && consoleUART.available()) {
-        String receivedString = consoleUART.readStringUntil('\n');
-		sendMessageToNotecard(trimEnd(receivedString).c_str());
+	// Do console output and input processing
+	if (consolePoll()) {
 		didSomething = true;
 	}
 
-	// Do Console USB processing
-	if (consoleUSBInitialized && consoleUSB.available()) {
-        String receivedString = consoleUSB.readStringUntil('\n');
-		sendMessageToNotecard(trimEnd(receivedString).c_str());
+	// Emit a telemetry summary if the aggregation window has closed
+	if (aggregatePoll()) {
 		didSomething = true;
 	}
 
@@ -225,44 +214,162 @@ bool mainPoll(void)
 
 }
 
-// Trim control chars from the end of the string
-String trimEnd(String str) {
-  int i = str.length() - 1;
-  while (i >= 0 && str[i] < ' ') {
-    i--;
-  }
-  return str.substring(0, i + 1);
+// Deliver a single inbound message to the consoles, returning the number of
+// console messages delivered.  A "class":"log" message is delivered as text, one
+// console line per line of the message.  Anything else is delivered as JSON after
+// having been assigned an ID, if it lacks one, so that a reply can be matched to
+// it.  If the message's original JSON text is supplied, it is delivered verbatim
+// when no ID needed to be added.
+uint32_t deliverMessage(J *message, const char *JSON)
+{
+	const char *hostCmd = JGetString(message, "class");
+	if (strEQL(hostCmd, "log")) {
+		return deliverLog(JGetString(message, "message"));
+	}
+	char *jsonTemp = NULL;
+	uint32_t messageID = JGetInt(message, "id");
+	int replyPort = consoleReplyPort(messageID);
+	if (messageID == 0) {
+		messageID = uniqueId();
+		JAddIntToObject(message, "id", messageID);
+		JSON = NULL;
+	}
+	if (JSON == NULL) {
+		jsonTemp = JPrintUnformatted(message);
+		if (jsonTemp == NULL) {
+			return 0;
+		}
+		JSON = jsonTemp;
+	}
+	bool assigned = false;
+	for (unsigned i=0; i<(sizeof(receivedMessageID)/sizeof(receivedMessageID[0])); i++) {
+		if (receivedMessageID[i] == 0 && !assigned) {
+			receivedMessageID[i] = messageID;
+			assigned = true;
+		} else if (receivedMessageID[i] == messageID) {
+			receivedMessageID[i] = 0;
+		}
+	}
+	consoleMakeRoom(CONSOLE_MAKE_ROOM_MS);
+	consolePublishText(JSON, CONSOLE_SUB_JSON, replyPort);
+	if (jsonTemp != NULL) {
+		_free(jsonTemp);
+	}
+	return 1;
+}
+
+// Deliver each line of a log message separately, so that many lines may be
+// batched into a single signal, returning the number of lines delivered.  Blank
+// lines within the message are delivered as such, and only a single trailing
+// newline is dropped, because each line is newline-terminated on delivery.
+uint32_t deliverLog(const char *message)
+{
+	uint32_t remaining = strlen(message);
+	if (remaining == 0) {
+		return 0;
+	}
+	if (message[remaining-1] == '\n') {
+		remaining--;
+	}
+	uint32_t lines = 0;
+	while (true) {
+		const char *eol = (const char *) memchr(message, '\n', remaining);
+		uint32_t len = (eol == NULL) ? remaining : (uint32_t) (eol - message);
+		consoleMakeRoom(CONSOLE_MAKE_ROOM_MS);
+		consolePublishLine(message, len, CONSOLE_SUB_LOG, -1);
+		lines++;
+		if (eol == NULL) {
+			break;
+		}
+		message += len + 1;
+		remaining -= len + 1;
+	}
+	return lines;
 }
 
-// Send a message to the notecard
-void sendMessageToNotecard(const char *message)
+// Note that a single signal carried many console messages
+void recordBatch(uint32_t count)
+{
+	signalBatches++;
+	signalBatchMessages += count;
+	if (count > signalBatchMax) {
+		signalBatchMax = count;
+	}
+	debugf("signal: batch of %d delivered, %d signals saved\n", count, count-1);
+}
+
+// Periodically report how much batching has saved, if there's been any since
+// the last report
+void reportSignalBatches(void)
+{
+	if (signalBatches == signalBatchesReported || (_millis() - signalLastReportedMs) < (SIGNAL_REPORT_SECS * 1000UL)) {
+		return;
+	}
+	uint32_t batches = signalBatches;
+	uint32_t messages = signalBatchMessages;
+	debugf("signal: received:%d batches:%d batched:%d max:%d\n", signalsReceived, batches, messages, signalBatchMax);
+	J *req = notecard.newRequest("note.add");
+	if (req == NULL) {
+		return;
+	}
+	JAddStringToObject(req, "file", SIGNAL_NOTEFILE);
+	J *body = JAddObjectToObject(req, "body");
+	if (body != NULL) {
+		JAddIntToObject(body, "received", signalsReceived);
+		JAddIntToObject(body, "batches", batches);
+		JAddIntToObject(body, "batched", messages);
+		JAddIntToObject(body, "max", signalBatchMax);
+		JAddIntToObject(body, "saved", messages - batches);
+	}
+	if (!notecard.sendRequest(req)) {
+		debugf("signal: can't send report\n");
+		return;
+	}
+	signalBatchesReported = batches;
+	signalLastReportedMs = _millis();
+}
+
+// Send a message received on a console port to the notecard
+void sendMessageToNotecard(const char *message, int port)
 {
 	if (message[0] == '\0') {
 		return;
 	}
 	bool isReply = false;
+	uint32_t messageID = 0;
 	bool isJSON = (message[0] == '{');
+
+	// Valid JSON goes out verbatim as the body of a request envelope, unless
+	// it's telemetry that may be absorbed by aggregation
+	outboundScanResult scan;
+	if (isJSON && outboundScan(message, &scan) && !(scan.allNumeric && scan.messageID == 0 && aggregateEnabled())) {
+		isReply = claimReceivedMessageID(scan.messageID);
+		if (!isReply) {
+			consoleMessageSent(scan.messageID, port);
+		}
+		outboundSend(message, isReply);
+		return;
+	}
+
+	// Otherwise, parse and repair it or wrap it as a log message
 	J *body = NULL;
 	if (isJSON) {
 		body = JParse(message);
 		if (body == NULL) {
 			isJSON = false;
 		} else {
-			uint32_t messageID = JGetInt(body, "id");
-			if (messageID != 0) {
-				for (unsigned i=0; i<(sizeof(receivedMessageID)/sizeof(receivedMessageID[0])); i++) {
-					if (receivedMessageID[i] == messageID) {
-						isReply = true;
-						receivedMessageID[i] = 0;
-						break;
-					}
-				}
+			messageID = JGetInt(body, "id");
+			isReply = claimReceivedMessageID(messageID);
+			if (!isReply && messageID == 0 && aggregateMessage(body)) {
+				JDelete(body);
+				return;
 			}
 		}
 	}
 	if (!isJSON) {
 		body = JCreateObject();
-		JAddNumberToObject(body, "id", uniqueId());
+		messageID = uniqueId();
+		JAddNumberToObject(body, "id", messageID);
 		JAddStringToObject(body, "class", "log");
 		JAddStringToObject(body, "message", message);
 	}
@@ -275,16 +382,44 @@ void sendMessageToNotecard(const char *message)
 			debugf("signal send failure");
 		}
 	} else {
-	    J *req = NoteNewCommand("web.post");
-		JAddStringToObject(req, "content", "application/json");
-		JAddStringToObject(req, "route", NOTEHUB_ROUTE_ALIAS);
-		JAddBoolToObject(req, "live", true);
-		JAddIntToObject(req, "seconds", 2);
-		JAddItemToObject(req, "body", body);
-		if (!notecard.sendRequest(req)) {
-			debugf("web request failure\n");
+		consoleMessageSent(messageID, port);
+		postToNotecard(body);
+	}
+}
+
+// If this ID is that of a message delivered to a console, it's a reply to it
+bool claimReceivedMessageID(uint32_t messageID)
+{
+	if (messageID == 0) {
+		return false;
+	}
+	for (unsigned i=0; i<(sizeof(receivedMessageID)/sizeof(receivedMessageID[0])); i++) {
+		if (receivedMessageID[i] == messageID) {
+			receivedMessageID[i] = 0;
+			return true;
 		}
 	}
+	return false;
+}
+
+// Post a body to the notehub route, taking ownership of the body
+bool postToNotecard(J *body)
+{
+    J *req = NoteNewCommand("web.post");
+	if (req == NULL) {
+		JDelete(body);
+		return false;
+	}
+	JAddStringToObject(req, "content", "application/json");
+	JAddStringToObject(req, "route", NOTEHUB_ROUTE_ALIAS);
+	JAddBoolToObject(req, "live", true);
+	JAddIntToObject(req, "seconds", 2);
+	JAddItemToObject(req, "body", body);
+	if (!notecard.sendRequest(req)) {
+		debugf("web request failure\n");
+		return false;
+	}
+	return true;
 }
 
 // uniqueID uses the time to get a unique identifier, pushing
@@ -10,6 +10,61 @@
 // main.cpp
 void mainTask(void *param);
 bool mainPoll(void);
+void sendMessageToNotecard(const char *message, int port);
+bool postToNotecard(J *body);
+uint32_t uniqueId(void);
+#define SIGNAL_REPORT_SECS          (6*60*60)
+#define SIGNAL_NOTEFILE             "signal.qo"
+
+// aggregate.cpp
+#define AGG_MAX_FIELDS              16
+#define AGG_FIELD_NAME_MAX          24
+#define AGG_ENV_SECONDS             "aggregate_seconds"
+#define AGG_ENV_CHANGE              "aggregate_change"
+void aggregateUpdateConfig(J *env);
+bool aggregateEnabled(void);
+bool aggregateMessage(J *body);
+bool aggregatePoll(void);
+
+// outbound.cpp
+#define OUTBOUND_BUFFER_SIZE        1024
+#define OUTBOUND_SCAN_DEPTH         16
+typedef struct {
+    uint32_t messageID;
+    bool allNumeric;
+} outboundScanResult;
+bool outboundScan(const char *json, outboundScanResult *result);
+bool outboundSend(const char *json, bool isReply);
+
+// console.cpp
+#define CONSOLE_MAX_PORTS           4
+#define CONSOLE_QUEUE_DEPTH         8       // buffers pending per port
+#define CONSOLE_SENT_IDS            32      // outbound IDs remembered for routing replies
+#define CONSOLE_MAKE_ROOM_MS        1000    // max wait for a full queue to drain
+#define CONSOLE_SUB_LOG             0x0001  // "class":"log" text lines
+#define CONSOLE_SUB_JSON            0x0002  // all inbound JSON messages
+#define CONSOLE_SUB_REPLIES         0x0004  // inbound JSON replying to a message this port sent
+#define CONSOLE_SUB_ENV             0x0008  // environment variable changes
+#define CONSOLE_SUB_DEFAULT         (CONSOLE_SUB_LOG|CONSOLE_SUB_JSON)
+#define CONSOLE_ENV_PREFIX          "console_"  // e.g. console_usb:"log,replies"
+typedef struct {
+    uint32_t refs;
+    uint32_t len;
+    char data[];
+} consoleBuffer;
+void consoleBegin(void);
+int consoleAddPort(const char *name, Stream *stream, bool reportsCapacity, uint32_t subscriptions);
+bool consolePoll(void);
+bool consoleOutput(void);
+void consoleMakeRoom(uint32_t timeoutMs);
+consoleBuffer *consoleBufferAlloc(uint32_t len);
+void consoleBufferRelease(consoleBuffer *buf);
+void consolePublish(consoleBuffer *buf, uint32_t subscription, int replyPort);
+void consolePublishText(const char *text, uint32_t subscription, int replyPort);
+void consolePublishLine(const char *text, uint32_t len, uint32_t subscription, int replyPort);
+void consoleMessageSent(uint32_t messageID, int port);
+int consoleReplyPort(uint32_t messageID);
+void consoleUpdateSubscriptions(J *env);
 
 // b64.cpp
 int b64decode_len(char *bufcoded);
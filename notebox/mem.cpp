@@ -0,0 +1,153 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "main.h"
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_heap_caps.h>
+#endif
+
+// Tasks whose stacks we monitor
+#define MEM_MAX_TASKS 4
+typedef struct {
+    const char *name;
+    TaskHandle_t handle;
+    uint32_t stackSize;
+} memTask;
+memTask memTasks[MEM_MAX_TASKS];
+uint32_t memTaskCount = 0;
+
+// Reporting state
+bool memReported = false;
+bool memWarned = false;
+uint32_t memLastReportedMs = 0;
+
+// Stack high-water marks are in words, except on ESP32 where they're in bytes
+#if defined(ARDUINO_ARCH_ESP32)
+#define MEM_STACK_UNIT_BYTES 1
+#else
+#define MEM_STACK_UNIT_BYTES sizeof(StackType_t)
+#endif
+
+// Forwards
+bool memLargestFreeBlock(uint32_t *largest);
+
+// Register the calling task so that its stack high-water mark is reported
+void memRegisterTask(const char *name, uint32_t stackSize)
+{
+    if (memTaskCount >= MEM_MAX_TASKS) {
+        return;
+    }
+    memTasks[memTaskCount].name = name;
+    memTasks[memTaskCount].handle = xTaskGetCurrentTaskHandle();
+    memTasks[memTaskCount].stackSize = stackSize;
+    memTaskCount++;
+}
+
+// Find the largest free heap block without allocating, since allocating would
+// lower the heap's minimum-ever-free figure.  Returns false where the heap
+// implementation has no way to report it, such as the newlib heap.
+bool memLargestFreeBlock(uint32_t *largest)
+{
+#if defined(ARDUINO_ARCH_ESP32)
+    *largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    return true;
+#elif defined(configMEMMANG_HEAP_NB) && (configMEMMANG_HEAP_NB == 4 || configMEMMANG_HEAP_NB == 5)
+    HeapStats_t heapStats;
+    vPortGetHeapStats(&heapStats);
+    *largest = heapStats.xSizeOfLargestFreeBlockInBytes;
+    return true;
+#else
+    *largest = 0;
+    return false;
+#endif
+}
+
+// Sample stack and heap health, logging it and warning when under threshold.  A
+// report is sent to the notehub periodically, and immediately upon a new warning,
+// so that stack and heap sizes can be tuned from field data.
+void memPoll(void)
+{
+    bool warn = false;
+
+    // Heap
+    uint32_t heapFree = xPortGetFreeHeapSize();
+    uint32_t heapMinFree = xPortGetMinimumEverFreeHeapSize();
+    uint32_t heapLargest;
+    bool haveHeapLargest = memLargestFreeBlock(&heapLargest);
+    debugf("mem: heap free:%d min:%d largest:%d\n", heapFree, heapMinFree, heapLargest);
+    if (heapMinFree < MEM_WARN_HEAP_FREE) {
+        debugf("mem: WARNING heap low-water mark %d is below %d\n", heapMinFree, MEM_WARN_HEAP_FREE);
+        warn = true;
+    }
+
+    // Stacks, converted to bytes
+    uint32_t stackUnused[MEM_MAX_TASKS];
+    for (uint32_t i=0; i<memTaskCount; i++) {
+        stackUnused[i] = uxTaskGetStackHighWaterMark(memTasks[i].handle) * MEM_STACK_UNIT_BYTES;
+        debugf("mem: task %s stack:%d unused:%d\n", memTasks[i].name, memTasks[i].stackSize * MEM_STACK_UNIT_BYTES, stackUnused[i]);
+        if (stackUnused[i] < MEM_WARN_STACK_UNUSED) {
+            debugf("mem: WARNING task %s has only %d stack unused\n", memTasks[i].name, stackUnused[i]);
+            warn = true;
+        }
+    }
+
+    // Allocations by subsystem
+    memSubsysStats stats[MEM_SUBSYS_COUNT];
+    for (uint32_t i=0; i<MEM_SUBSYS_COUNT; i++) {
+        _malloc_stats(i, &stats[i]);
+        debugf("mem: %s allocs:%d frees:%d failures:%d bytes:%d peak:%d\n", _malloc_subsys_name(i),
+               stats[i].allocs, stats[i].frees, stats[i].failures, stats[i].bytes, stats[i].peakBytes);
+    }
+
+    // Decide whether or not it's time to report
+    bool newWarning = warn && !memWarned;
+    memWarned = warn;
+    if (memReported && !newWarning && (_millis() - memLastReportedMs) < (MEM_REPORT_SECS * 1000UL)) {
+        return;
+    }
+    memReported = true;
+    memLastReportedMs = _millis();
+
+    // Send the report
+    J *req = notecard.newRequest("note.add");
+    if (req == NULL) {
+        return;
+    }
+    JAddStringToObject(req, "file", MEM_NOTEFILE);
+    J *body = JAddObjectToObject(req, "body");
+    if (body != NULL) {
+        JAddBoolToObject(body, "warn", warn);
+        J *heap = JAddObjectToObject(body, "heap");
+        if (heap != NULL) {
+            JAddIntToObject(heap, "free", heapFree);
+            JAddIntToObject(heap, "min", heapMinFree);
+            if (haveHeapLargest) {
+                JAddIntToObject(heap, "largest", heapLargest);
+            }
+        }
+        J *tasks = JAddObjectToObject(body, "tasks");
+        for (uint32_t i=0; tasks != NULL && i<memTaskCount; i++) {
+            J *task = JAddObjectToObject(tasks, memTasks[i].name);
+            if (task != NULL) {
+                JAddIntToObject(task, "stack", memTasks[i].stackSize * MEM_STACK_UNIT_BYTES);
+                JAddIntToObject(task, "unused", stackUnused[i]);
+            }
+        }
+        J *alloc = JAddObjectToObject(body, "alloc");
+        for (uint32_t i=0; alloc != NULL && i<MEM_SUBSYS_COUNT; i++) {
+            J *subsys = JAddObjectToObject(alloc, _malloc_subsys_name(i));
+            if (subsys != NULL) {
+                JAddIntToObject(subsys, "allocs", stats[i].allocs);
+                JAddIntToObject(subsys, "frees", stats[i].frees);
+                JAddIntToObject(subsys, "failures", stats[i].failures);
+                JAddIntToObject(subsys, "bytes", stats[i].bytes);
+                JAddIntToObject(subsys, "peak", stats[i].peakBytes);
+            }
+        }
+    }
+    if (!notecard.sendRequest(req)) {
+        debugf("mem: can't send report\n");
+    }
+
+}
@@ -35,6 +35,12 @@ void setup()
 	notecard.setFnNoteMutex(_lock_note, _unlock_note);
 	notecard.setFnI2cMutex(_lock_wire, _unlock_wire);
 
+	// Route note-c allocations through our accounting (see NoteRTOS.h), noting
+	// that this must precede any J allocation because blocks carry a header.
+	// setFn replaces note-c's delay and millis hooks as well, so those are
+	// pointed at the RTOS-aware _delay and _millis.
+	notecard.setFn(_malloc_note, _free, _delay, _millis);
+
 	// Initialize the notecard transport
 #ifdef SERIAL_NOTECARD
     notecard.begin(notecardSerial, 9600);
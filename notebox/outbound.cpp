@@ -0,0 +1,239 @@
+// Copyright 2024 Blues Inc.  All rights reserved.
+// Use of this source code is governed by licenses granted by the
+// copyright holder including that found in the LICENSE file.
+
+#include "main.h"
+
+// Envelopes into which the host's JSON is spliced as the body.  These are
+// equivalent to the requests that would otherwise be built as J trees.
+#define OUTBOUND_POST_ENVELOPE      "{\"cmd\":\"web.post\",\"route\":\"" NOTEHUB_ROUTE_ALIAS "\",\"content\":\"application/json\",\"live\":true,\"seconds\":2,\"body\":"
+#define OUTBOUND_SIGNAL_ENVELOPE    "{\"cmd\":\"hub.signal\",\"live\":true,\"seconds\":2,\"body\":"
+#define OUTBOUND_ENVELOPE_MAX       (sizeof(OUTBOUND_POST_ENVELOPE) > sizeof(OUTBOUND_SIGNAL_ENVELOPE) ? sizeof(OUTBOUND_POST_ENVELOPE) : sizeof(OUTBOUND_SIGNAL_ENVELOPE))
+#define OUTBOUND_BODY_MAX           (OUTBOUND_BUFFER_SIZE - OUTBOUND_ENVELOPE_MAX - sizeof("}\n"))
+
+// Preallocated request buffer, only ever used from the polling task
+char outboundBuffer[OUTBOUND_BUFFER_SIZE];
+
+// Forwards
+const char *outboundScanWS(const char *p);
+const char *outboundScanString(const char *p);
+const char *outboundScanNumber(const char *p);
+const char *outboundScanArray(const char *p, uint32_t depth);
+const char *outboundScanValue(const char *p, uint32_t depth);
+const char *outboundScanObject(const char *p, uint32_t depth, outboundScanResult *result);
+
+// Skip whitespace
+const char *outboundScanWS(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+    return p;
+}
+
+// Scan a string, returning a pointer past its closing quote or NULL if invalid
+const char *outboundScanString(const char *p)
+{
+    if (*p++ != '"') {
+        return NULL;
+    }
+    while (*p != '"') {
+        if ((uint8_t) *p < ' ') {
+            return NULL;
+        }
+        if (*p == '\\') {
+            p++;
+            if (*p == 'u') {
+                for (int i=0; i<4; i++) {
+                    if (!isxdigit((uint8_t) *++p)) {
+                        return NULL;
+                    }
+                }
+            } else if (*p == '\0' || strchr("\"\\/bfnrt", *p) == NULL) {
+                return NULL;
+            }
+        }
+        p++;
+    }
+    return p+1;
+}
+
+// Scan a number
+const char *outboundScanNumber(const char *p)
+{
+    if (*p == '-') {
+        p++;
+    }
+    if (*p == '0') {
+        p++;
+    } else if (isdigit((uint8_t) *p)) {
+        while (isdigit((uint8_t) *p)) {
+            p++;
+        }
+    } else {
+        return NULL;
+    }
+    if (*p == '.') {
+        p++;
+        if (!isdigit((uint8_t) *p)) {
+            return NULL;
+        }
+        while (isdigit((uint8_t) *p)) {
+            p++;
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') {
+            p++;
+        }
+        if (!isdigit((uint8_t) *p)) {
+            return NULL;
+        }
+        while (isdigit((uint8_t) *p)) {
+            p++;
+        }
+    }
+    return p;
+}
+
+// Scan an array
+const char *outboundScanArray(const char *p, uint32_t depth)
+{
+    p = outboundScanWS(p+1);
+    if (*p == ']') {
+        return p+1;
+    }
+    while (true) {
+        p = outboundScanValue(p, depth);
+        if (p == NULL) {
+            return NULL;
+        }
+        p = outboundScanWS(p);
+        if (*p == ']') {
+            return p+1;
+        }
+        if (*p++ != ',') {
+            return NULL;
+        }
+        p = outboundScanWS(p);
+    }
+}
+
+// Scan any value
+const char *outboundScanValue(const char *p, uint32_t depth)
+{
+    if (++depth > OUTBOUND_SCAN_DEPTH) {
+        return NULL;
+    }
+    switch (*p) {
+    case '{':
+        return outboundScanObject(p, depth, NULL);
+    case '[':
+        return outboundScanArray(p, depth);
+    case '"':
+        return outboundScanString(p);
+    case 't':
+        return (0 == strncmp(p, "true", 4)) ? p+4 : NULL;
+    case 'f':
+        return (0 == strncmp(p, "false", 5)) ? p+5 : NULL;
+    case 'n':
+        return (0 == strncmp(p, "null", 4)) ? p+4 : NULL;
+    }
+    return outboundScanNumber(p);
+}
+
+// Scan an object, gathering what we need to know about its top level fields
+// if a result is supplied.
+const char *outboundScanObject(const char *p, uint32_t depth, outboundScanResult *result)
+{
+    bool foundID = false;
+    p = outboundScanWS(p+1);
+    if (*p == '}') {
+        return p+1;
+    }
+    while (true) {
+        const char *name = p;
+        p = outboundScanString(p);
+        if (p == NULL) {
+            return NULL;
+        }
+        p = outboundScanWS(p);
+        if (*p++ != ':') {
+            return NULL;
+        }
+        p = outboundScanWS(p);
+        const char *value = p;
+        p = outboundScanValue(p, depth);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (result != NULL) {
+            bool isNumber = (*value == '-' || isdigit((uint8_t) *value));
+            if (!isNumber) {
+                result->allNumeric = false;
+            }
+            if (!foundID && (0 == strncmp(name, "\"id\"", 4))) {
+                foundID = true;
+                if (isNumber) {
+                    result->messageID = (uint32_t) (long long) atof(value);
+                }
+            }
+        }
+        p = outboundScanWS(p);
+        if (*p == '}') {
+            return p+1;
+        }
+        if (*p++ != ',') {
+            return NULL;
+        }
+        p = outboundScanWS(p);
+    }
+}
+
+// Validate a line of JSON without allocating, returning false if it would need
+// repair by the tree path or won't fit in the request buffer.  The message ID
+// is 0 if absent or not a number.
+bool outboundScan(const char *json, outboundScanResult *result)
+{
+    result->messageID = 0;
+    result->allNumeric = true;
+    if (strlen(json) > OUTBOUND_BODY_MAX) {
+        return false;
+    }
+    const char *p = outboundScanWS(json);
+    if (*p != '{') {
+        return false;
+    }
+    p = outboundScanObject(p, 1, result);
+    if (p == NULL) {
+        return false;
+    }
+    return *outboundScanWS(p) == '\0';
+}
+
+// Send already-valid JSON as the body of a web.post, or of a hub.signal if it is
+// a reply, by splicing it into a request envelope in a preallocated buffer.
+// Returns false without sending if it doesn't fit.
+bool outboundSend(const char *json, bool isReply)
+{
+    const char *envelope = isReply ? OUTBOUND_SIGNAL_ENVELOPE : OUTBOUND_POST_ENVELOPE;
+    uint32_t envelopeLen = strlen(envelope);
+    uint32_t jsonLen = strlen(json);
+    if (envelopeLen + jsonLen + sizeof("}\n") > sizeof(outboundBuffer)) {
+        return false;
+    }
+    char *p = outboundBuffer;
+    memcpy(p, envelope, envelopeLen);
+    p += envelopeLen;
+    memcpy(p, json, jsonLen);
+    p += jsonLen;
+    memcpy(p, "}\n", sizeof("}\n"));
+
+    // Commands have no response, but be safe in case one comes back
+    char *rsp = NoteRequestResponseJSON(outboundBuffer);
+    if (rsp != NULL) {
+        NoteFree(rsp);
+    }
+    return true;
+}
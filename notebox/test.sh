@@ -3,3 +3,5 @@ notehub '{"product":"com.blues.notebox","device":"dev:ed153172025c","req":"hub.d
 notehub '{"product":"com.blues.notebox","device":"dev:ed153172025c","req":"hub.device.signal","body":{"id":123,"text":"hi there"}}'
 # reply {"id":123,"text":"hi back"}
 notehub '{"product":"com.blues.notebox","device":"dev:ed153172025c","req":"hub.device.signal","seconds":30}'
+notehub '{"product":"com.blues.notebox","device":"dev:ed153172025c","req":"hub.device.signal","body":{"batch":[{"id":124,"text":"one"},{"class":"log","message":"two"},{"text":"three"}]}}'
+notehub '{"product":"com.blues.notebox","device":"dev:ed153172025c","req":"hub.device.signal","body":{"class":"log","message":"line one\nline two"}}'
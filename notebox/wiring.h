@@ -8,6 +8,11 @@
 #define	WIRING_RX_FM_CONSOLE_TX			PIN_SERIAL_RX	// Console's TX is wired to F_RX
 #define	CONSOLE_UART_SPEED				115200
 
+// Define these to attach a second console host to a spare UART/LPUART
+//#define	WIRING_TX_TO_CONSOLE2_RX		PIN_SERIAL_LP1_TX
+//#define	WIRING_RX_FM_CONSOLE2_TX		PIN_SERIAL_LP1_RX
+//#define	CONSOLE2_UART_SPEED				115200
+
 #define	WIRING_TX_TO_NOTECARD_AUX_RX	A4				// AUX_RX is wired to F_A4 (PC4, USART3_TX, AF7) 
 #define	WIRING_RX_FM_NOTECARD_AUX_TX	A5				// AUX_TX is wired to F_A5 (PC5, USART3_RX, AF7)
 #define	NOTECARD_AUX_SPEED				115200